@@ -1,4 +1,15 @@
+// nftw() and FTW_PHYS, for manifest.h, need XSI extensions, and
+// tee(), for passthru.h, is a GNU one.
+#define _GNU_SOURCE
+
 #include "bitops.h"
+#include "crcengine.h"
+#include "rolling.h"
+#include "noise.h"
+#include "manifest.h"
+#include "passthru.h"
+#include <time.h>
+#include <getopt.h>
 #include "unistd.h"
 
 /**
@@ -12,6 +23,10 @@
 
 #define LOG stdout
 
+#define OPT_MANIFEST_WRITE 0x100
+#define OPT_MANIFEST_CHECK 0x101
+#define OPT_MANIFEST_CACHE 0x102
+
 #define SEND_RECV 2
 #define SEND 1
 #define RECV 0
@@ -20,6 +35,11 @@ bitarray_t * CRC(bitarray_t *message,
                  uint32_t generator,
                  unsigned char mode);
 
+int parse_size(const char *arg, size_t max, size_t *size);
+int multi_frame(FILE *fd, uint32_t generator, size_t frame_size);
+int window_scan(FILE *fd, uint32_t generator, size_t window,
+                uint32_t mask, uint32_t target, int jobs);
+
 int verbose = 1;
 
 int main(int argc, char **argv){
@@ -28,14 +48,32 @@ int main(int argc, char **argv){
   char fmt[8];
   int inputformat = 0;
   uint32_t input;
-  char opt;
+  int opt;
   char direction = SEND_RECV;
   char input_as_binary = FALSE;
   char output_binary_only = FALSE;
-  int burst_length = 0;
+  char pass_through = FALSE;
+  noise_channel_t channel = {NOISE_NONE};
+  uint64_t seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+  char *end;
   char random_msg = TRUE;
   int random_msg_size = 1520;
   uint32_t generator = DEFAULT_GENERATOR;
+  char *manifest_out = NULL;
+  char *manifest_in = NULL;
+  char *manifest_cache = NULL;
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  struct option longopts[] = {
+    {"manifest-write", required_argument, NULL, OPT_MANIFEST_WRITE},
+    {"manifest-check", required_argument, NULL, OPT_MANIFEST_CHECK},
+    {"manifest-cache", required_argument, NULL, OPT_MANIFEST_CACHE},
+    {"jobs", required_argument, NULL, 'j'},
+    {NULL, 0, NULL, 0}
+  };
+  size_t frame_size = 0;
+  size_t window = 0;
+  uint32_t roll_mask = 0xffffffff;
+  uint32_t roll_target = 0;
 
   if (is_big_endian()){
     fprintf(stderr, "*****************************************\n"
@@ -53,7 +91,8 @@ int main(int argc, char **argv){
   // Parse the command line arguments. 
   if (argc < MINARGS)
     goto help;
-  while ((opt = getopt(argc, argv, "srbvf:qg:ce:ho")) != -1){
+  while ((opt = getopt_long(argc, argv, "srbvf:qg:ce:hom:w:k:t:S:j:p",
+                            longopts, NULL)) != -1){
     switch(opt) {
     case 'b':
       input_as_binary = TRUE;
@@ -71,6 +110,9 @@ int main(int argc, char **argv){
     case 'r':
       direction = RECV;
       break;
+    case 'p':
+      pass_through = TRUE;
+      break;
     case 'g':
       if (optarg[0] == '0' && optarg[1] == 'x')
         sscanf(optarg,"0x%x",&generator);
@@ -94,7 +136,49 @@ int main(int argc, char **argv){
       verbose = FALSE;
       break;
     case 'e':
-      burst_length = atoi(optarg);
+      if (noise_parse(optarg, &channel)){
+        fprintf(stderr, "Invalid noise model %s. Exiting.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'S':
+      // As with -e, strtoull() would wrap a negative seed around.
+      errno = 0;
+      seed = strtoull(optarg, &end, 0);
+      if (*optarg < '0' || *optarg > '9' || *end || errno){
+        fprintf(stderr, "Invalid seed %s. Exiting.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case OPT_MANIFEST_WRITE:
+      manifest_out = optarg;
+      break;
+    case OPT_MANIFEST_CHECK:
+      manifest_in = optarg;
+      break;
+    case OPT_MANIFEST_CACHE:
+      manifest_cache = optarg;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 'm':
+      if (parse_size(optarg, SIZE_MAX / 2, &frame_size)){
+        fprintf(stderr, "Invalid frame size %s. Exiting.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'w':
+      if (parse_size(optarg, ROLL_MAX_WINDOW, &window)){
+        fprintf(stderr, "Invalid window size %s. Exiting.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'k':
+      roll_mask = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      roll_target = strtoul(optarg, NULL, 0);
       break;
     case 'h':
     default:
@@ -111,8 +195,21 @@ int main(int argc, char **argv){
              "-b: read input as binary string of ASCII '0's and '1's\n"
              "-c: read input as raw characters [default]\n"
              "-o: output bitstring only: use with -b to chain CRC pipes together\n"
+             "-p: pass raw input through unchanged; with -s, append remainder\n"
+             "    bytes, and with -r, check and strip them\n"
              "-e <burst length>: introduce burst error of <burst length> bits\n"
+             "-e bsc:<p>: flip each bit with probability <p>\n"
+             "-e ge:<p_gb>,<p_bg>,<e_g>,<e_b>: Gilbert-Elliott bursty channel\n"
+             "-S <seed>: seed the noise generator, for repeatable runs\n"
+             "--manifest-write <manifest> [PATHS]: record residues of files\n"
+             "--manifest-check <manifest>: verify files against a manifest\n"
+             "--manifest-cache <cache>: skip files unchanged since last run\n"
+             "-j, --jobs <n>: threads for -w and the manifest [default: all CPUs]\n"
              "-g <generator>: supply alternate CRC polynomial in hex or decimal\n"
+             "-m <frame size>: split input into frames, and print each residue\n"
+             "-w <window>: print offsets of <window>-byte windows matching -k/-t\n"
+             "-k <mask>: residue bits compared by -w [default: all]\n"
+             "-t <target>: value the masked residue must have for -w [default: 0]\n"
              "-h: display this help menu.\n"
              , argv[0]);
       exit(EXIT_FAILURE);
@@ -123,6 +220,62 @@ int main(int argc, char **argv){
   opt=0;
   bitarray_t *orig_msg;
 
+  // Pass-through mode: stdout carries the data itself, so any
+  // report goes to stderr instead.
+  if (pass_through){
+    crc_engine_t engine;
+    uint32_t residue;
+    if (crc_engine_init(&engine, generator)){
+      fprintf(stderr, "Invalid generator 0x%x. Exiting.\n", generator);
+      exit(EXIT_FAILURE);
+    }
+    int mode = (direction == SEND)? PASSTHRU_APPEND :
+      (direction == RECV)? PASSTHRU_STRIP : PASSTHRU_PLAIN;
+    if (passthru(&engine, fileno(fd), STDOUT_FILENO, mode, &residue)){
+      fprintf(stderr, "Error passing input through. Exiting.\n");
+      exit(EXIT_FAILURE);
+    }
+    // Only a stripped trailer says anything about corruption; with
+    // -s, or with no trailer at all, the residue is just reported.
+    if (verbose && residue)
+      fprintf(stderr, "%s*** RESIDUE: 0x%lx\n",
+              (mode == PASSTHRU_STRIP)? "*** CORRUPTION DETECTED ***\n" : "",
+              (unsigned long int) residue);
+    return (mode == PASSTHRU_STRIP)? !!residue : 0;
+  }
+
+  // Manifest mode: residues of whole files, rather than of a
+  // message, written to or checked against a manifest file. The
+  // check takes its generator from the manifest, if it names one.
+  if (manifest_in)
+    return manifest_check(generator, manifest_in, manifest_cache,
+                          jobs, verbose);
+  if (manifest_out){
+    crc_engine_t engine;
+    if (crc_engine_init(&engine, generator)){
+      fprintf(stderr, "Invalid generator 0x%x. Exiting.\n", generator);
+      exit(EXIT_FAILURE);
+    }
+    char *here = ".";
+    return (optind < argc)?
+      manifest_write(&engine, manifest_out, argv + optind, argc - optind,
+                     manifest_cache, jobs) :
+      manifest_write(&engine, manifest_out, &here, 1, manifest_cache, jobs);
+  }
+
+  // In multi-frame mode, the input is cut into frames of frame_size
+  // bytes (the last may be shorter), and their residues are computed
+  // together by the batch engine in crcengine.h.
+  if (frame_size)
+    return multi_frame(fd, generator, frame_size);
+
+  // In window mode, the input is streamed through a rolling CRC, and
+  // the offset of every window whose masked residue hits the target
+  // is printed. As with grep, we return 0 if anything matched.
+  if (window)
+    return window_scan(fd, generator, window, roll_mask, roll_target,
+                       jobs);
+
   // Read the input as ASCII '0's and '1's if requested, and
   // convert to an actual bitarray
   if (input_as_binary == FALSE){ 
@@ -145,11 +298,15 @@ int main(int argc, char **argv){
   bitarray_t *prep_msg = (direction >= SEND)?
     CRC(orig_msg, generator, SEND) : orig_msg;
   
-  // Introduce a burst error, if requested (by command-line option
-  // -e <length>). This may be either a burst of 1s or a burst of 0s. 
-  if (burst_length){
-    burst_error(prep_msg->array, prep_msg->end/8,
-                burst_length, (char) clock()%2);
+  // Spoil the message, if requested (by command-line option -e).
+  // See noise.h for the channel models available.
+  if (channel.model != NOISE_NONE){
+    noise_rng_t rng;
+    noise_seed(&rng, seed);
+    unsigned long int flips = noise_apply(&rng, &channel,
+                                          prep_msg->array, prep_msg->end);
+    if (verbose)
+      fprintf(LOG, "NOISE: %lu BITS FLIPPED\n", flips);
   }
 
   // Check the resulting message for bit errors. If no burst errors
@@ -305,3 +462,104 @@ bitarray_t * CRC(bitarray_t *message,
 
   return bitmsg_out;
 }
+
+
+/**
+ * Parse a size given on the command line: a positive number, in
+ * decimal or hex, and nothing else. strtoull() on its own would
+ * quietly wrap a negative number round, and ignore trailing junk.
+ *
+ * @return int : 0 on success, -1 if the argument is malformed, 0,
+ *         or larger than max
+ * @param const char *arg : the argument to parse
+ * @param size_t max : the largest size allowed
+ * @param size_t *size : set to the size
+ **/
+int parse_size(const char *arg, size_t max, size_t *size){
+  char *end;
+  unsigned long long n;
+  if (*arg < '0' || *arg > '9')
+    return -1;
+  errno = 0;
+  n = strtoull(arg, &end, 0);
+  if (*end || errno || n == 0 || n > max)
+    return -1;
+  *size = n;
+  return 0;
+}
+
+/**
+ * Print the residue of each frame_size-byte frame of the input, one
+ * per line, and return 1 if any of them is nonzero, 0 otherwise.
+ **/
+int multi_frame(FILE *fd, uint32_t generator, size_t frame_size){
+  crc_engine_t engine;
+  if (crc_engine_init(&engine, generator)){
+    fprintf(stderr, "Invalid generator 0x%x. Exiting.\n", generator);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t len, n, i;
+  uint8_t *data = read_bytes(fd, &len);
+  n = (len + frame_size - 1) / frame_size;
+  crc_frame_t *frames = calloc(n, sizeof(crc_frame_t));
+  uint32_t *residues = calloc(n, sizeof(uint32_t));
+  for (i = 0; i < n; i++){
+    frames[i].data = data + i*frame_size;
+    frames[i].len = (i == n-1)? len - i*frame_size : frame_size;
+  }
+
+  crc_batch(&engine, frames, n, residues);
+
+  int retval = 0;
+  for (i = 0; i < n; i++){
+    printf("%lu 0x%lx\n", (unsigned long int) i,
+           (unsigned long int) residues[i]);
+    retval |= !!residues[i];
+  }
+
+  free(residues);
+  free(frames);
+  free(data);
+  return retval;
+}
+
+
+void print_window_match(unsigned long int offset, uint32_t residue){
+  printf("%lu 0x%lx\n", offset, (unsigned long int) residue);
+}
+
+/**
+ * Print the offset and residue of every window of the input whose
+ * residue, masked with mask, equals target. Return 0 if there was
+ * at least one such window, 1 otherwise. A residue only has as many
+ * bits as the generator's degree, so a target or mask reaching
+ * beyond that is refused (except for the default all-ones mask).
+ **/
+int window_scan(FILE *fd, uint32_t generator, size_t window,
+                uint32_t mask, uint32_t target, int jobs){
+  crc_engine_t engine;
+  crc_roller_t roller;
+  if (crc_engine_init(&engine, generator)){
+    fprintf(stderr, "Invalid generator 0x%x. Exiting.\n", generator);
+    exit(EXIT_FAILURE);
+  }
+  uint32_t widthmask = ~(0xffffffff << engine.width);
+  if (mask == 0xffffffff)
+    mask = widthmask;
+  if ((target | mask) & ~widthmask){
+    fprintf(stderr, "Mask 0x%x or target 0x%x has bits beyond the "
+            "%d-bit residue of generator 0x%x. Exiting.\n",
+            mask, target, engine.width, generator);
+    exit(EXIT_FAILURE);
+  }
+  crc_roller_init(&roller, &engine, window);
+  long int matches = crc_roll_scan(fd, &roller, mask, target, jobs,
+                                   print_window_match);
+  if (matches < 0){
+    fprintf(stderr, "Window of %lu bytes is too big. Exiting.\n",
+            (unsigned long int) window);
+    exit(EXIT_FAILURE);
+  }
+  return !matches;
+}
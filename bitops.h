@@ -242,6 +242,9 @@ void byte2bitstring(unsigned char byte, unsigned char *arr){
  * @param int errbitlen : the length of the burst error
  * @param int highlow : 0 or 1, depending on whether you 
  *        want a burst of low noise or high noise. 
+ *
+ * See noise_burst() in noise.h for a burst that is guaranteed
+ * to flip its first and last bits.
  **/
 void burst_error(unsigned char *message, int msglen,
                  int errbitlen, int highlow){
@@ -395,6 +398,31 @@ char * read_characters (FILE *channel, char endsig){
   return string;
 }
 
+/**
+ * Read everything remaining on a file descriptor as raw bytes,
+ * flexibly allocating an array on the heap to store them in. Unlike
+ * read_characters(), this is safe for binary input containing NULs
+ * or 0xff. Remember to call free() when finished with the array.
+ *
+ * @return uint8_t * : the bytes read
+ * @param FILE *channel : the file descriptor to read from
+ * @param size_t *len : set to the number of bytes read
+ **/
+uint8_t * read_bytes (FILE *channel, size_t *len){
+  size_t size = 0x10000;
+  uint8_t *bytes = malloc(size);
+  size_t n;
+  *len = 0;
+  while ((n = fread(bytes + *len, 1, size - *len, channel)) > 0){
+    *len += n;
+    if (*len == size){
+      size *= 2;
+      bytes = realloc(bytes, size);
+    }
+  }
+  return bytes;
+}
+
 /**
  * Read up to a determinate number of characters from a given
  * file descriptor, and flexibly allocate an array to store 
@@ -10,7 +10,7 @@
 OUTFILE=crc-experiment.out
 (figlet "CRC Tester" 2> /dev/null || echo -e "CRC TESTER\n=-=-=-=-=-\n") 
 
-gcc CRC.c -o CRC
+gcc CRC.c -o CRC -lm -pthread
 if (( $? != 0 )); then
     echo Error compiling CRC.c.
     echo Exiting.
@@ -99,8 +99,8 @@ echo
   echo CONTROL GROUP. MISSED BURSTS OF THE FOLLOWING SIZES:
   echo $MISSES | tr " " "\\n" | sort -n| uniq | tr "\\n" " "
   echo -e "\n"
-  echo Note that small bursts may be undetected simply because they failed to
-  echo flip any bits. This is also possible for large bursts, but less likely.
+  echo Note that every burst flips its first and last bits, so a burst of
+  echo length n spans exactly n bits.
   echo 
   echo "=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-="
   echo "BURST ERROR LENGTH     |    NUMBER OF FRAMES     |    NUMBER DETECTED"
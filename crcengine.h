@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * CRC engine: a table-driven equivalent of the shift-register
+ * routine in CRC.c, for when we want residues quickly and don't
+ * need the step-by-step trace.
+ *
+ * The register is kept in reflected form (the bit that entered
+ * the shift register first sits in the LSb), since CRC.c feeds
+ * each byte LSb first. That lets us consume a whole byte with a
+ * single table lookup, for generators of any degree from 1 to 31.
+ * crc_engine_residue() turns the register back into the value
+ * that CRC() leaves in bitarray_t's residue field.
+ *
+ * Include after bitops.h, whose bitarray_t and getbit() it uses.
+ **/
+
+#define CRC_LANES 8
+
+typedef struct crc_engine {
+  uint32_t generator;
+  int width;        // degree of the generator; shiftbitlen in CRC()
+  uint32_t poly;    // reflected xorplate
+  uint32_t table[256];
+} crc_engine_t;
+
+// One frame of a batch: a pointer to its bytes, and their number.
+typedef struct crc_frame {
+  const uint8_t *data;
+  size_t len;
+} crc_frame_t;
+
+/**
+ * Reverse the order of the lowest width bits of an integer.
+ *
+ * @return uint32_t : the reflected bits
+ * @param uint32_t x : the integer to reflect
+ * @param int width  : the number of low-order bits to reflect
+ **/
+uint32_t reflect_bits(uint32_t x, int width){
+  uint32_t r = 0;
+  int i;
+  for (i = 0; i < width; i++){
+    r = (r << 1) | (x & 1);
+    x >>= 1;
+  }
+  return r;
+}
+
+/**
+ * Prepare an engine for the given generator, building the lookup
+ * table that advances the register by one byte.
+ *
+ * @return int : 0 on success, -1 if the generator has degree 0
+ * @param crc_engine_t *e : the engine to initialize
+ * @param uint32_t generator : the CRC polynomial, as given to -g
+ **/
+int crc_engine_init(crc_engine_t *e, uint32_t generator){
+  int width = 0;
+  uint32_t g = generator;
+  while ((g >>= 1) != 0)
+    width ++;
+  if (width == 0)
+    return -1;
+
+  e->generator = generator;
+  e->width = width;
+  // As in CRC(), the MSB of the generator is dropped.
+  e->poly = reflect_bits(generator, width);
+
+  uint32_t i;
+  int k;
+  for (i = 0; i < 256; i++){
+    uint32_t reg = i;
+    for (k = 0; k < 8; k++)
+      reg = (reg & 1)? (reg >> 1) ^ e->poly : reg >> 1;
+    e->table[i] = reg;
+  }
+  return 0;
+}
+
+/**
+ * Feed a run of bytes through the register, one lookup per byte.
+ * Start from a register of 0 to match CRC().
+ *
+ * @return uint32_t : the new (reflected) register
+ * @param const crc_engine_t *e : the engine to use
+ * @param uint32_t reg : the register to continue from
+ * @param const uint8_t *buf : the bytes to feed
+ * @param size_t len : the number of bytes to feed
+ **/
+uint32_t crc_engine_update(const crc_engine_t *e, uint32_t reg,
+                           const uint8_t *buf, size_t len){
+  const uint32_t *t = e->table;
+  while (len--)
+    reg = (reg >> 8) ^ t[(reg ^ *buf++) & 0xff];
+  return reg;
+}
+
+/**
+ * Feed individual bits through the register, for messages that
+ * don't end on a byte boundary (such as those read with -b).
+ *
+ * @return uint32_t : the new (reflected) register
+ * @param const crc_engine_t *e : the engine to use
+ * @param uint32_t reg : the register to continue from
+ * @param const uint8_t *buf : the byte array holding the bits
+ * @param unsigned long int from : index of the first bit to feed
+ * @param unsigned long int to   : index of the last bit to feed + 1
+ **/
+uint32_t crc_engine_update_bits(const crc_engine_t *e, uint32_t reg,
+                                const uint8_t *buf,
+                                unsigned long int from,
+                                unsigned long int to){
+  while (from < to){
+    reg ^= getbit(buf, from++);
+    reg = (reg & 1)? (reg >> 1) ^ e->poly : reg >> 1;
+  }
+  return reg;
+}
+
+/**
+ * Convert a reflected register into a residue, in the form that
+ * CRC() stores in the residue field of a bitarray_t.
+ *
+ * @return uint32_t : the residue
+ **/
+uint32_t crc_engine_residue(const crc_engine_t *e, uint32_t reg){
+  return reflect_bits(reg, e->width);
+}
+
+/**
+ * Compute the residue of a byte array in one call.
+ *
+ * @return uint32_t : the residue, as CRC() would report it
+ * @param const crc_engine_t *e : the engine to use
+ * @param const uint8_t *buf : the message
+ * @param size_t len : the length of the message, in bytes
+ **/
+uint32_t crc_bytes(const crc_engine_t *e, const uint8_t *buf, size_t len){
+  return crc_engine_residue(e, crc_engine_update(e, 0, buf, len));
+}
+
+/**
+ * Compute the residue of a bitarray, honouring its end field, so
+ * that the result agrees with CRC(message, generator, RECV).
+ *
+ * @return uint32_t : the residue
+ **/
+uint32_t crc_bitarray(const crc_engine_t *e, const bitarray_t *ba){
+  uint32_t reg = crc_engine_update(e, 0, ba->array, ba->end / 8);
+  reg = crc_engine_update_bits(e, reg, ba->array,
+                               (ba->end / 8) * 8, ba->end);
+  return crc_engine_residue(e, reg);
+}
+
+/**
+ * Advance CRC_LANES registers over len bytes of their respective
+ * frames, in lockstep. The lanes are independent, so the compiler
+ * and CPU can overlap their lookups, which a single byte-wise CRC
+ * can't do, since each lookup waits on the one before it.
+ *
+ * @param const crc_engine_t *e : the engine to use
+ * @param uint32_t *reg : CRC_LANES registers, updated in place
+ * @param const uint8_t **p : CRC_LANES data pointers, advanced
+ * @param size_t len : bytes to consume from every lane
+ **/
+void crc_lanes_update(const crc_engine_t *e, uint32_t *reg,
+                      const uint8_t **p, size_t len){
+  const uint32_t *t = e->table;
+  size_t i;
+  int l;
+  for (i = 0; i < len; i++)
+    for (l = 0; l < CRC_LANES; l++)
+      reg[l] = (reg[l] >> 8) ^ t[(reg[l] ^ p[l][i]) & 0xff];
+  for (l = 0; l < CRC_LANES; l++)
+    p[l] += len;
+}
+
+typedef struct crc_batch_slot {
+  size_t len;
+  size_t index;
+} crc_batch_slot_t;
+
+int crc_batch_slot_cmp(const void *a, const void *b){
+  size_t x = ((const crc_batch_slot_t *) a)->len;
+  size_t y = ((const crc_batch_slot_t *) b)->len;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Compute the residues of many independent frames at once. Frames
+ * are sorted by length and dealt out CRC_LANES at a time, so that
+ * each group shares as long a common prefix as possible. The common
+ * prefix is run through all lanes together, and the short leftover
+ * tails are finished one frame at a time.
+ *
+ * @param const crc_engine_t *e : the engine to use
+ * @param const crc_frame_t *frames : the frames to check
+ * @param size_t n : the number of frames
+ * @param uint32_t *residues : n residues, in the order of frames
+ **/
+void crc_batch(const crc_engine_t *e, const crc_frame_t *frames,
+               size_t n, uint32_t *residues){
+  crc_batch_slot_t *slots = calloc(n, sizeof(crc_batch_slot_t));
+  size_t i;
+  int l;
+  for (i = 0; i < n; i++){
+    slots[i].len = frames[i].len;
+    slots[i].index = i;
+  }
+  qsort(slots, n, sizeof(crc_batch_slot_t), crc_batch_slot_cmp);
+
+  for (i = 0; i + CRC_LANES <= n; i += CRC_LANES){
+    uint32_t reg[CRC_LANES] = {0};
+    const uint8_t *p[CRC_LANES];
+    size_t common = slots[i].len;
+    for (l = 0; l < CRC_LANES; l++)
+      p[l] = frames[slots[i+l].index].data;
+
+    crc_lanes_update(e, reg, p, common);
+
+    for (l = 0; l < CRC_LANES; l++){
+      const crc_frame_t *f = &frames[slots[i+l].index];
+      reg[l] = crc_engine_update(e, reg[l], p[l], f->len - common);
+      residues[slots[i+l].index] = crc_engine_residue(e, reg[l]);
+    }
+  }
+  // Fewer than CRC_LANES frames left over: do them one by one.
+  for (; i < n; i++){
+    const crc_frame_t *f = &frames[slots[i].index];
+    residues[slots[i].index] = crc_bytes(e, f->data, f->len);
+  }
+  free(slots);
+}
@@ -0,0 +1,563 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <errno.h>
+#include <pthread.h>
+
+/**
+ * Manifest library: record the residues of every file in a tree,
+ * and check them again later, in the manner of sha256sum -c.
+ *
+ * A manifest is a text file, beginning with a line naming the
+ * generator it was written with, followed by one line per file:
+ *
+ *   # CRC generator 0x4c11db7
+ *   2d05c24  path/to/file
+ *
+ * Files are checked in parallel, by a pool of threads that each
+ * take the next unclaimed file. Optionally, a cache maps each
+ * file's (device, inode, size, mtime, generator) to its residue, so
+ * that files which haven't been touched since the last run are not
+ * read again. Bear in mind that this trusts the file's metadata:
+ * corruption that leaves the size and mtime alone (bit rot, say)
+ * will only be caught by a run without the cache.
+ *
+ * The cache may be shared between manifests and trees: records for
+ * files a run doesn't touch are kept as they are. Each record also
+ * notes the file's absolute path, so that when a run finds a file
+ * missing, or replaced by another inode, the old record is dropped.
+ *
+ * Include after crcengine.h. Link with -pthread.
+ **/
+
+#define MANIFEST_BUFSIZE 0x100000
+#define MANIFEST_HEADER "# CRC generator "
+
+#define MANIFEST_OK      0
+#define MANIFEST_FAILED  1
+#define MANIFEST_MISSING 2
+
+typedef struct manifest_entry {
+  char *path;
+  uint32_t expected;  // residue recorded in the manifest
+  uint32_t residue;   // residue found now
+  int status;
+  struct stat st;
+} manifest_entry_t;
+
+typedef struct manifest_list {
+  manifest_entry_t *entries;
+  size_t n;
+  size_t size;
+} manifest_list_t;
+
+typedef struct manifest_cache_entry {
+  uint64_t dev, ino, size, mtime_ns;
+  uint32_t generator;
+  uint32_t residue;
+  char *path;         // absolute path when recorded, if known
+} manifest_cache_entry_t;
+
+typedef struct manifest_cache {
+  manifest_cache_entry_t *entries;
+  size_t n;
+} manifest_cache_t;
+
+// Shared between the worker threads of manifest_compute().
+typedef struct manifest_job {
+  const crc_engine_t *engine;
+  const manifest_cache_t *cache;
+  manifest_list_t *list;
+  size_t next;
+  pthread_mutex_t lock;
+} manifest_job_t;
+
+/**
+ * Append a path to a list of entries, growing it as needed.
+ **/
+manifest_entry_t * manifest_push(manifest_list_t *list, const char *path){
+  if (list->n == list->size){
+    list->size = list->size? list->size * 2 : 0x100;
+    list->entries = realloc(list->entries,
+                            list->size * sizeof(manifest_entry_t));
+  }
+  manifest_entry_t *m = &list->entries[list->n++];
+  memset(m, 0, sizeof(manifest_entry_t));
+  m->path = strdup(path);
+  return m;
+}
+
+void manifest_free(manifest_list_t *list){
+  size_t i;
+  for (i = 0; i < list->n; i++)
+    free(list->entries[i].path);
+  free(list->entries);
+}
+
+/**
+ * The absolute form of a path, without resolving symbolic links or
+ * "..", so that it works for files which no longer exist.
+ *
+ * @return char * : a newly allocated string
+ **/
+char * manifest_abspath(const char *path){
+  char *cwd, *abs;
+  if (path[0] == '/' || (cwd = getcwd(NULL, 0)) == NULL)
+    return strdup(path);
+  abs = malloc(strlen(cwd) + strlen(path) + 2);
+  sprintf(abs, "%s/%s", cwd, path);
+  free(cwd);
+  return abs;
+}
+
+uint64_t manifest_mtime_ns(const struct stat *st){
+  return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL
+    + st->st_mtim.tv_nsec;
+}
+
+/**
+ * Compute the residue of a file's contents.
+ *
+ * @return int : 0 on success, -1 if the file couldn't be read
+ * @param const crc_engine_t *e : the engine to use
+ * @param const char *path : the file to read
+ * @param uint32_t *residue : set to the residue
+ **/
+int manifest_crc_file(const crc_engine_t *e, const char *path,
+                      uint32_t *residue){
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  uint8_t *buf = malloc(MANIFEST_BUFSIZE);
+  uint32_t reg = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, MANIFEST_BUFSIZE)) != 0){
+    if (n < 0){
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    reg = crc_engine_update(e, reg, buf, n);
+  }
+  free(buf);
+  close(fd);
+  if (n < 0)
+    return -1;
+  *residue = crc_engine_residue(e, reg);
+  return 0;
+}
+
+int manifest_cache_cmp(const void *a, const void *b){
+  const manifest_cache_entry_t *x = a, *y = b;
+  if (x->dev != y->dev)
+    return (x->dev > y->dev) - (x->dev < y->dev);
+  if (x->ino != y->ino)
+    return (x->ino > y->ino) - (x->ino < y->ino);
+  return (x->generator > y->generator) - (x->generator < y->generator);
+}
+
+int manifest_cache_path_cmp(const void *a, const void *b){
+  return strcmp(((const manifest_cache_entry_t *) a)->path,
+                ((const manifest_cache_entry_t *) b)->path);
+}
+
+/**
+ * Load a cache file, if there is one. A missing cache is just an
+ * empty one. Records are "<dev> <ino> <size> <mtime_ns> <generator>
+ * <residue> <path>"; the path may be absent, as in older caches.
+ **/
+void manifest_cache_load(manifest_cache_t *cache, const char *path){
+  size_t size = 0x100, linesize = 0;
+  manifest_cache_entry_t c;
+  unsigned long long dev, ino, sz, mtime;
+  unsigned int gen, res;
+  char *line = NULL;
+  ssize_t len;
+  int end;
+  FILE *f = fopen(path, "r");
+  cache->n = 0;
+  cache->entries = malloc(size * sizeof(manifest_cache_entry_t));
+  if (f == NULL)
+    return;
+  while ((len = getline(&line, &linesize, f)) > 0){
+    if (line[len-1] == '\n')
+      line[len-1] = '\0';
+    if (sscanf(line, "%llu %llu %llu %llu %x %x%n",
+               &dev, &ino, &sz, &mtime, &gen, &res, &end) != 6)
+      continue;
+    c.dev = dev; c.ino = ino; c.size = sz; c.mtime_ns = mtime;
+    c.generator = gen; c.residue = res;
+    c.path = (line[end] == ' ' && line[end+1])? strdup(line + end + 1)
+      : NULL;
+    if (cache->n == size){
+      size *= 2;
+      cache->entries = realloc(cache->entries,
+                               size * sizeof(manifest_cache_entry_t));
+    }
+    cache->entries[cache->n++] = c;
+  }
+  free(line);
+  fclose(f);
+  qsort(cache->entries, cache->n, sizeof(manifest_cache_entry_t),
+        manifest_cache_cmp);
+}
+
+/**
+ * Look up a file in the cache.
+ *
+ * @return int : TRUE if the cache holds a residue for this file, as
+ *         it is now, under this generator (stored in *residue)
+ **/
+int manifest_cache_lookup(const manifest_cache_t *cache,
+                          const struct stat *st, uint32_t generator,
+                          uint32_t *residue){
+  manifest_cache_entry_t key, *hit;
+  key.dev = st->st_dev;
+  key.ino = st->st_ino;
+  key.generator = generator;
+  hit = bsearch(&key, cache->entries, cache->n,
+                sizeof(manifest_cache_entry_t), manifest_cache_cmp);
+  if (hit == NULL || hit->size != (uint64_t) st->st_size
+      || hit->mtime_ns != manifest_mtime_ns(st))
+    return FALSE;
+  *residue = hit->residue;
+  return TRUE;
+}
+
+void manifest_cache_fprint(FILE *f, const manifest_cache_entry_t *c){
+  fprintf(f, "%llu %llu %llu %llu %x %x",
+          (unsigned long long) c->dev, (unsigned long long) c->ino,
+          (unsigned long long) c->size, (unsigned long long) c->mtime_ns,
+          c->generator, c->residue);
+  // A path with a newline in it would break the record; leave it out.
+  if (c->path && !strchr(c->path, '\n'))
+    fprintf(f, " %s", c->path);
+  fputc('\n', f);
+}
+
+void manifest_cache_free(manifest_cache_t *cache){
+  size_t i;
+  for (i = 0; i < cache->n; i++)
+    free(cache->entries[i].path);
+  free(cache->entries);
+}
+
+/**
+ * Decide whether an old cache record has been overtaken by this run:
+ * either there is a fresh record for the same file, or this run
+ * visited the path it was recorded under, and found the file missing
+ * (seen with dev and ino 0) or a different inode in its place.
+ **/
+int manifest_cache_stale(const manifest_cache_entry_t *old,
+                         const manifest_cache_entry_t *fresh, size_t n,
+                         const manifest_cache_entry_t *seen, size_t nseen){
+  const manifest_cache_entry_t *hit;
+  if (bsearch(old, fresh, n, sizeof(manifest_cache_entry_t),
+              manifest_cache_cmp))
+    return TRUE;
+  if (old->path == NULL)
+    return FALSE;
+  hit = bsearch(old, seen, nseen, sizeof(manifest_cache_entry_t),
+                manifest_cache_path_cmp);
+  return hit && (hit->dev != old->dev || hit->ino != old->ino);
+}
+
+/**
+ * Write the cache back out, with fresh records for every file that
+ * was read successfully this time, and the old records for files
+ * that weren't involved, less those this run found to be gone. The
+ * new cache replaces the old one atomically, so an interrupted run
+ * can't leave it half-written.
+ **/
+void manifest_cache_save(manifest_cache_t *cache, const char *path,
+                         const manifest_list_t *list, uint32_t generator){
+  size_t i, n = 0;
+  manifest_cache_entry_t *fresh =
+    malloc((list->n + 1) * sizeof(manifest_cache_entry_t));
+  manifest_cache_entry_t *seen =
+    calloc(list->n + 1, sizeof(manifest_cache_entry_t));
+  for (i = 0; i < list->n; i++){
+    const manifest_entry_t *m = &list->entries[i];
+    seen[i].path = manifest_abspath(m->path);
+    if (m->status == MANIFEST_MISSING)
+      continue;
+    seen[i].dev = m->st.st_dev;
+    seen[i].ino = m->st.st_ino;
+    fresh[n].dev = m->st.st_dev;
+    fresh[n].ino = m->st.st_ino;
+    fresh[n].size = m->st.st_size;
+    fresh[n].mtime_ns = manifest_mtime_ns(&m->st);
+    fresh[n].generator = generator;
+    fresh[n].residue = m->residue;
+    fresh[n].path = seen[i].path;
+    n++;
+  }
+  qsort(fresh, n, sizeof(manifest_cache_entry_t), manifest_cache_cmp);
+  qsort(seen, list->n, sizeof(manifest_cache_entry_t),
+        manifest_cache_path_cmp);
+
+  char *tmp = malloc(strlen(path) + 8);
+  sprintf(tmp, "%s.XXXXXX", path);
+  int fd = mkstemp(tmp);
+  if (fd >= 0)
+    fchmod(fd, 0644);
+  FILE *f = (fd < 0)? NULL : fdopen(fd, "w");
+  if (f == NULL){
+    fprintf(stderr, "Error writing cache %s.\n", path);
+    for (i = 0; i < list->n; i++)
+      free(seen[i].path);
+    free(seen);
+    free(tmp);
+    free(fresh);
+    return;
+  }
+  // This run's records supersede the old ones for the same file.
+  for (i = 0; i < n; i++)
+    if (i == 0 || manifest_cache_cmp(&fresh[i-1], &fresh[i]))
+      manifest_cache_fprint(f, &fresh[i]);
+  for (i = 0; i < cache->n; i++)
+    if (!manifest_cache_stale(&cache->entries[i], fresh, n,
+                              seen, list->n))
+      manifest_cache_fprint(f, &cache->entries[i]);
+  if (fclose(f) != 0 || rename(tmp, path) != 0){
+    fprintf(stderr, "Error writing cache %s.\n", path);
+    unlink(tmp);
+  }
+  for (i = 0; i < list->n; i++)
+    free(seen[i].path);
+  free(seen);
+  free(tmp);
+  free(fresh);
+}
+
+void * manifest_worker(void *arg){
+  manifest_job_t *job = arg;
+  manifest_entry_t *m;
+  for (;;){
+    pthread_mutex_lock(&job->lock);
+    m = (job->next < job->list->n)? &job->list->entries[job->next++] : NULL;
+    pthread_mutex_unlock(&job->lock);
+    if (m == NULL)
+      return NULL;
+
+    if (stat(m->path, &m->st) != 0){
+      m->status = MANIFEST_MISSING;
+      continue;
+    }
+    if (!(job->cache && manifest_cache_lookup(job->cache, &m->st,
+                                              job->engine->generator,
+                                              &m->residue))
+        && manifest_crc_file(job->engine, m->path, &m->residue)){
+      m->status = MANIFEST_MISSING;
+      continue;
+    }
+    m->status = (m->residue == m->expected)? MANIFEST_OK : MANIFEST_FAILED;
+  }
+}
+
+/**
+ * Compute the residues of every file in a list, with the given
+ * number of threads, consulting the cache (which may be NULL).
+ **/
+void manifest_compute(const crc_engine_t *e, const manifest_cache_t *cache,
+                      manifest_list_t *list, int jobs){
+  manifest_job_t job;
+  pthread_t *threads;
+  int i;
+  if (jobs < 1)
+    jobs = 1;
+  if ((size_t) jobs > list->n)
+    jobs = list->n? list->n : 1;
+  job.engine = e;
+  job.cache = cache;
+  job.list = list;
+  job.next = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  threads = calloc(jobs, sizeof(pthread_t));
+  for (i = 1; i < jobs; i++)
+    pthread_create(&threads[i], NULL, manifest_worker, &job);
+  manifest_worker(&job);
+  for (i = 1; i < jobs; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  pthread_mutex_destroy(&job.lock);
+}
+
+// nftw() gives us no way to pass our list along, so it waits here,
+// along with the files the walk must leave out: the manifest and
+// cache themselves, which would otherwise list their own residues.
+manifest_list_t *manifest_walk_list;
+struct stat manifest_walk_skip[2];
+int manifest_walk_nskip;
+
+int manifest_walk_visit(const char *path, const struct stat *st,
+                        int type, struct FTW *ftw){
+  int i;
+  if (type == FTW_F && S_ISREG(st->st_mode)){
+    for (i = 0; i < manifest_walk_nskip; i++)
+      if (st->st_dev == manifest_walk_skip[i].st_dev
+          && st->st_ino == manifest_walk_skip[i].st_ino)
+        return 0;
+    if (strchr(path, '\n'))
+      fprintf(stderr, "Skipping %s: newline in file name.\n", path);
+    else
+      manifest_push(manifest_walk_list, path);
+  } else if (type == FTW_DNR || type == FTW_NS){
+    fprintf(stderr, "Error reading %s.\n", path);
+  }
+  return 0;
+}
+
+int manifest_path_cmp(const void *a, const void *b){
+  return strcmp(((const manifest_entry_t *) a)->path,
+                ((const manifest_entry_t *) b)->path);
+}
+
+/**
+ * Write a manifest of every regular file beneath the given paths
+ * (without following symbolic links), leaving out the manifest and
+ * cache files themselves.
+ *
+ * @return int : 0 on success, 1 if any file couldn't be read
+ * @param const crc_engine_t *e : the engine to use
+ * @param const char *manifest : the manifest file to write
+ * @param char **paths : the files and trees to include
+ * @param int npaths : the number of paths
+ * @param const char *cachepath : the cache file, or NULL
+ * @param int jobs : the number of threads to use
+ **/
+int manifest_write(const crc_engine_t *e, const char *manifest,
+                   char **paths, int npaths, const char *cachepath,
+                   int jobs){
+  manifest_list_t list = {NULL, 0, 0};
+  manifest_cache_t cache = {NULL, 0};
+  int i, retval = 0;
+  size_t j;
+
+  manifest_walk_list = &list;
+  manifest_walk_nskip = 0;
+  if (stat(manifest, &manifest_walk_skip[manifest_walk_nskip]) == 0)
+    manifest_walk_nskip ++;
+  if (cachepath
+      && stat(cachepath, &manifest_walk_skip[manifest_walk_nskip]) == 0)
+    manifest_walk_nskip ++;
+  for (i = 0; i < npaths; i++)
+    if (nftw(paths[i], manifest_walk_visit, 64, FTW_PHYS) != 0){
+      fprintf(stderr, "Error reading %s.\n", paths[i]);
+      retval = 1;
+    }
+  qsort(list.entries, list.n, sizeof(manifest_entry_t), manifest_path_cmp);
+
+  if (cachepath)
+    manifest_cache_load(&cache, cachepath);
+  manifest_compute(e, cachepath? &cache : NULL, &list, jobs);
+
+  FILE *f = fopen(manifest, "w");
+  if (f == NULL){
+    fprintf(stderr, "Error opening %s. Exiting.\n", manifest);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, MANIFEST_HEADER "0x%lx\n", (unsigned long int) e->generator);
+  for (j = 0; j < list.n; j++){
+    manifest_entry_t *m = &list.entries[j];
+    if (m->status == MANIFEST_MISSING){
+      fprintf(stderr, "Error reading %s.\n", m->path);
+      retval = 1;
+      continue;
+    }
+    fprintf(f, "%lx  %s\n", (unsigned long int) m->residue, m->path);
+  }
+  fclose(f);
+
+  if (cachepath)
+    manifest_cache_save(&cache, cachepath, &list, e->generator);
+  manifest_cache_free(&cache);
+  manifest_free(&list);
+  return retval;
+}
+
+/**
+ * Check every file listed in a manifest, printing "path: OK",
+ * "path: FAILED" (with the residue found, when verbose), or
+ * "path: MISSING" for each. The generator named in the manifest's
+ * header, if any, takes precedence over the one given.
+ *
+ * @return int : 0 if every file checked out, 1 otherwise
+ **/
+int manifest_check(uint32_t generator, const char *manifest,
+                   const char *cachepath, int jobs, int verbose){
+  manifest_list_t list = {NULL, 0, 0};
+  manifest_cache_t cache = {NULL, 0};
+  crc_engine_t engine;
+  int retval = 0;
+  size_t j, failed = 0, missing = 0;
+  unsigned long int expected;
+  char *line = NULL, *end;
+  size_t linesize = 0;
+  ssize_t len;
+
+  FILE *f = fopen(manifest, "r");
+  if (f == NULL){
+    fprintf(stderr, "Error opening %s. Exiting.\n", manifest);
+    exit(EXIT_FAILURE);
+  }
+  while ((len = getline(&line, &linesize, f)) > 0){
+    if (line[len-1] == '\n')
+      line[len-1] = '\0';
+    if (!strncmp(line, MANIFEST_HEADER, strlen(MANIFEST_HEADER))){
+      generator = strtoul(line + strlen(MANIFEST_HEADER), NULL, 0);
+      continue;
+    }
+    // Lines are "<residue>  <path>", as written by manifest_write().
+    expected = strtoul(line, &end, 16);
+    if (end != line && end[0] == ' ' && end[1] == ' ' && end[2] != '\0')
+      manifest_push(&list, end + 2)->expected = expected;
+    else if (line[0] != '\0' && line[0] != '#')
+      fprintf(stderr, "Ignoring malformed line: %s\n", line);
+  }
+  free(line);
+  fclose(f);
+
+  if (crc_engine_init(&engine, generator)){
+    fprintf(stderr, "Invalid generator 0x%x. Exiting.\n", generator);
+    exit(EXIT_FAILURE);
+  }
+  if (cachepath)
+    manifest_cache_load(&cache, cachepath);
+  manifest_compute(&engine, cachepath? &cache : NULL, &list, jobs);
+
+  for (j = 0; j < list.n; j++){
+    manifest_entry_t *m = &list.entries[j];
+    switch (m->status){
+    case MANIFEST_OK:
+      if (verbose)
+        printf("%s: OK\n", m->path);
+      break;
+    case MANIFEST_FAILED:
+      failed ++;
+      if (verbose)
+        printf("%s: FAILED (RESIDUE 0x%lx)\n", m->path,
+               (unsigned long int) m->residue);
+      else
+        printf("%s: FAILED\n", m->path);
+      break;
+    default:
+      missing ++;
+      printf("%s: MISSING\n", m->path);
+      break;
+    }
+  }
+  if (failed || missing){
+    fprintf(stderr, "WARNING: %lu of %lu files FAILED, %lu MISSING\n",
+            (unsigned long int) failed, (unsigned long int) list.n,
+            (unsigned long int) missing);
+    retval = 1;
+  }
+
+  if (cachepath)
+    manifest_cache_save(&cache, cachepath, &list, engine.generator);
+  manifest_cache_free(&cache);
+  manifest_free(&list);
+  return retval;
+}
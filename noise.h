@@ -0,0 +1,285 @@
+#include <math.h>
+#include <limits.h>
+
+/**
+ * Noise library: channel models for spoiling messages in CRC
+ * experiments, going beyond the single burst of burst_error().
+ *
+ * Three models are offered:
+ *  - an exact burst of n bits, whose first and last bits are always
+ *    flipped, and whose interior bits are each flipped with
+ *    probability 1/2 (so every burst really is n bits long);
+ *  - a binary symmetric channel, flipping each bit independently
+ *    with probability p;
+ *  - a Gilbert-Elliott channel, which wanders between a good and a
+ *    bad state, each with its own bit error rate, producing the
+ *    clustered errors seen on real links.
+ *
+ * Rather than rolling the dice once per bit, the random models draw
+ * the distance to the next error (or state change) from a geometric
+ * distribution, so simulating a low error rate costs time in
+ * proportion to the number of errors, not the number of bits.
+ *
+ * All randomness comes from a seedable noise_rng_t, so a run can be
+ * repeated exactly. Link with -lm.
+ *
+ * Include after bitops.h, whose flipbit() it uses.
+ **/
+
+#define NOISE_NONE  0
+#define NOISE_BURST 1
+#define NOISE_BSC   2
+#define NOISE_GE    3
+
+// A small xorshift64* generator: fast, and good enough for noise.
+typedef struct noise_rng {
+  uint64_t state;
+} noise_rng_t;
+
+// A channel model, and (for Gilbert-Elliott) its current state,
+// which carries over from one message to the next.
+typedef struct noise_channel {
+  int model;
+  unsigned long int burst;  // NOISE_BURST: burst length, in bits
+  double p;                 // NOISE_BSC: bit error rate
+  double p_gb;              // NOISE_GE: P(good -> bad) per bit
+  double p_bg;              // NOISE_GE: P(bad -> good) per bit
+  double e_good;            // NOISE_GE: bit error rate when good
+  double e_bad;             // NOISE_GE: bit error rate when bad
+  int bad;                  // NOISE_GE: TRUE while in the bad state
+} noise_channel_t;
+
+/**
+ * Seed a generator. Any seed, including 0, is fine: it is scrambled
+ * (with a splitmix64 step) before use.
+ *
+ * @param noise_rng_t *rng : the generator to seed
+ * @param uint64_t seed : the seed
+ **/
+void noise_seed(noise_rng_t *rng, uint64_t seed){
+  uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  rng->state = z? z : 0x9e3779b97f4a7c15ULL;
+}
+
+/**
+ * @return uint64_t : the next 64 random bits
+ **/
+uint64_t noise_next(noise_rng_t *rng){
+  uint64_t x = rng->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rng->state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * @return double : a uniform random number in (0, 1]
+ **/
+double noise_uniform(noise_rng_t *rng){
+  return ((noise_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Draw the number of failures before the first success, in a run
+ * of trials that each succeed with probability p. This is the gap
+ * we skip between errors.
+ *
+ * @return unsigned long int : the gap, or ULONG_MAX if p is 0
+ * @param noise_rng_t *rng : the generator to use
+ * @param double p : the probability of success per trial
+ **/
+unsigned long int noise_geometric(noise_rng_t *rng, double p){
+  if (p <= 0)
+    return ULONG_MAX;
+  if (p >= 1)
+    return 0;
+  double g = floor(log(noise_uniform(rng)) / log1p(-p));
+  return (g >= (double) ULONG_MAX)? ULONG_MAX : (unsigned long int) g;
+}
+
+/**
+ * Flip bits at rate p within bits [from, to) of a message, skipping
+ * geometrically from one error to the next.
+ *
+ * @return unsigned long int : the number of bits flipped
+ **/
+unsigned long int noise_scatter(noise_rng_t *rng, unsigned char *message,
+                                unsigned long int from,
+                                unsigned long int to, double p){
+  unsigned long int flips = 0, skip;
+  while (from < to){
+    skip = noise_geometric(rng, p);
+    if (skip >= to - from)
+      break;
+    from += skip;
+    flipbit(message, from++);
+    flips ++;
+  }
+  return flips;
+}
+
+/**
+ * Introduce a burst error of exactly burstbits bits at a random
+ * location: the first and last bits of the burst are flipped, and
+ * those in between are flipped with probability 1/2. Bursts longer
+ * than the message are cut down to the message length.
+ *
+ * @return unsigned long int : the number of bits flipped
+ * @param noise_rng_t *rng : the generator to use
+ * @param unsigned char *message : the array to spoil
+ * @param unsigned long int msgbits : the length of the message, in bits
+ * @param unsigned long int burstbits : the length of the burst
+ **/
+unsigned long int noise_burst(noise_rng_t *rng, unsigned char *message,
+                              unsigned long int msgbits,
+                              unsigned long int burstbits){
+  if (burstbits > msgbits)
+    burstbits = msgbits;
+  if (burstbits == 0)
+    return 0;
+
+  unsigned long int start = noise_next(rng) % (msgbits - burstbits + 1);
+  unsigned long int last = start + burstbits - 1;
+  unsigned long int i, flips = 1;
+  uint64_t coins = 0;
+  flipbit(message, start);
+  for (i = start + 1; i < last; i++){
+    if ((i - start - 1) % 64 == 0)
+      coins = noise_next(rng);
+    if (coins & 1){
+      flipbit(message, i);
+      flips ++;
+    }
+    coins >>= 1;
+  }
+  if (last != start){
+    flipbit(message, last);
+    flips ++;
+  }
+  return flips;
+}
+
+/**
+ * Pass a message through a binary symmetric channel.
+ *
+ * @return unsigned long int : the number of bits flipped
+ * @param noise_rng_t *rng : the generator to use
+ * @param unsigned char *message : the array to spoil
+ * @param unsigned long int msgbits : the length of the message, in bits
+ * @param double p : the bit error rate
+ **/
+unsigned long int noise_bsc(noise_rng_t *rng, unsigned char *message,
+                            unsigned long int msgbits, double p){
+  return noise_scatter(rng, message, 0, msgbits, p);
+}
+
+/**
+ * Pass a message through a Gilbert-Elliott channel. The time spent
+ * in each state is drawn geometrically, and errors are scattered
+ * through it at that state's rate. The channel's state is left as
+ * it was at the end of the message.
+ *
+ * @return unsigned long int : the number of bits flipped
+ * @param noise_rng_t *rng : the generator to use
+ * @param noise_channel_t *ch : the channel, updated in place
+ * @param unsigned char *message : the array to spoil
+ * @param unsigned long int msgbits : the length of the message, in bits
+ **/
+unsigned long int noise_gilbert_elliott(noise_rng_t *rng,
+                                        noise_channel_t *ch,
+                                        unsigned char *message,
+                                        unsigned long int msgbits){
+  unsigned long int pos = 0, stay, end, flips = 0;
+  char leaves;
+  while (pos < msgbits){
+    // We stay for this bit, plus one per failure to leave after it.
+    stay = noise_geometric(rng, ch->bad? ch->p_bg : ch->p_gb);
+    leaves = (stay < msgbits - pos);
+    end = leaves? pos + stay + 1 : msgbits;
+    flips += noise_scatter(rng, message, pos, end,
+                           ch->bad? ch->e_bad : ch->e_good);
+    if (leaves)
+      ch->bad = !ch->bad;
+    pos = end;
+  }
+  return flips;
+}
+
+/**
+ * Spoil a message according to a channel model.
+ *
+ * @return unsigned long int : the number of bits flipped
+ **/
+unsigned long int noise_apply(noise_rng_t *rng, noise_channel_t *ch,
+                              unsigned char *message,
+                              unsigned long int msgbits){
+  switch (ch->model){
+  case NOISE_BURST:
+    return noise_burst(rng, message, msgbits, ch->burst);
+  case NOISE_BSC:
+    return noise_bsc(rng, message, msgbits, ch->p);
+  case NOISE_GE:
+    return noise_gilbert_elliott(rng, ch, message, msgbits);
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Parse a probability, which must lie in [0, 1].
+ *
+ * @return int : 0 on success, -1 if there is no number, or it is
+ *         out of range
+ * @param const char *s : the text to parse
+ * @param char **end : set to the first character after the number
+ * @param double *p : set to the probability
+ **/
+int noise_parse_prob(const char *s, char **end, double *p){
+  *p = strtod(s, end);
+  if (*end == s || !(*p >= 0 && *p <= 1))
+    return -1;
+  return 0;
+}
+
+/**
+ * Parse a channel description, as given to the -e option:
+ *   <n>                         an exact burst of n bits (0 for none)
+ *   bsc:<p>                     a binary symmetric channel
+ *   ge:<p_gb>,<p_bg>,<e_g>,<e_b> a Gilbert-Elliott channel, starting
+ *                               in the good state
+ *
+ * @return int : 0 on success, -1 if the description is malformed,
+ *         or a probability lies outside [0, 1]
+ * @param const char *spec : the description
+ * @param noise_channel_t *ch : the channel to fill in
+ **/
+int noise_parse(const char *spec, noise_channel_t *ch){
+  char *end;
+  memset(ch, 0, sizeof(noise_channel_t));
+  if (!strncmp(spec, "bsc:", 4)){
+    ch->model = NOISE_BSC;
+    return (noise_parse_prob(spec + 4, &end, &ch->p) || *end)? -1 : 0;
+  }
+  if (!strncmp(spec, "ge:", 3)){
+    ch->model = NOISE_GE;
+    end = (char *) spec + 2;
+    if (noise_parse_prob(end + 1, &end, &ch->p_gb) || *end != ','
+        || noise_parse_prob(end + 1, &end, &ch->p_bg) || *end != ','
+        || noise_parse_prob(end + 1, &end, &ch->e_good) || *end != ','
+        || noise_parse_prob(end + 1, &end, &ch->e_bad) || *end)
+      return -1;
+    return 0;
+  }
+  // strtoul() would quietly wrap a negative number around.
+  if (*spec < '0' || *spec > '9')
+    return -1;
+  ch->burst = strtoul(spec, &end, 0);
+  if (*end)
+    return -1;
+  ch->model = ch->burst? NOISE_BURST : NOISE_NONE;
+  return 0;
+}
@@ -0,0 +1,284 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+/**
+ * Pass-through library: forward a byte stream unchanged while
+ * computing its CRC on the fly, for use in the middle of a pipeline.
+ *
+ * On the sending side, the remainder is appended to the stream as
+ * raw bytes; on the receiving side, those bytes are checked and
+ * stripped off again. The remainder occupies the first width bits of
+ * the trailer, in the same order that CRC() appends them to a
+ * bitarray, and the trailer is padded with zeros to a whole number
+ * of bytes. Since trailing zeros don't disturb a zero residue, the
+ * stream with its trailer still checks out with the other modes
+ * (-m, say).
+ *
+ * Copying is avoided where the file descriptors allow it:
+ *  - a regular file is mapped into memory for the CRC, and sent on
+ *    with sendfile();
+ *  - between two pipes, the data is duplicated into the output pipe
+ *    with tee(), and only read (once) for the CRC;
+ *  - anything else falls back to read() and write().
+ * When stripping, the last few bytes of the stream might be the
+ * trailer, so they are held back until we know they aren't.
+ *
+ * Include after crcengine.h. Needs _GNU_SOURCE, for tee().
+ **/
+
+#define PASSTHRU_BUFSIZE 0x40000
+
+#define PASSTHRU_PLAIN  0   // forward as is, just compute the residue
+#define PASSTHRU_APPEND 1   // append the remainder (SEND)
+#define PASSTHRU_STRIP  2   // check and strip the remainder (RECV)
+
+typedef struct passthru {
+  const crc_engine_t *engine;
+  uint32_t reg;
+  size_t hold;          // bytes at the end of the stream to keep back
+  uint8_t carry[4];     // bytes consumed, but not yet forwarded
+  size_t ncarry;
+} passthru_t;
+
+/**
+ * Write all of a buffer, however many calls it takes.
+ *
+ * @return int : 0 on success, -1 on error
+ **/
+int passthru_write_all(int fd, const uint8_t *buf, size_t len){
+  ssize_t n;
+  while (len){
+    n = write(fd, buf, len);
+    if (n < 0){
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Read exactly len bytes (which must already be waiting in the pipe),
+ * feeding them through the CRC.
+ **/
+int passthru_consume(passthru_t *pt, int in, uint8_t *buf, size_t len){
+  ssize_t n;
+  while (len){
+    n = read(in, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    pt->reg = crc_engine_update(pt->engine, pt->reg, buf, n);
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * The regular file case: map it, CRC the mapping, and let the
+ * kernel copy it to the output.
+ **/
+int passthru_file(passthru_t *pt, int in, int out, off_t size){
+  if (size < (off_t) pt->hold)
+    return -1;
+  uint8_t *map = (size == 0)? NULL :
+    mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  if (size)
+    madvise(map, size, MADV_SEQUENTIAL);
+
+  size_t body = size - pt->hold;
+  off_t offset = 0;
+  ssize_t n;
+  pt->reg = crc_engine_update(pt->engine, pt->reg, map, size);
+  while ((size_t) offset < body){
+    n = sendfile(out, in, &offset, body - offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0){
+      // sendfile() won't go to every kind of fd; write from the map.
+      if (passthru_write_all(out, map + offset, body - offset))
+        break;
+      offset = body;
+    }
+  }
+  if (size){
+    memcpy(pt->carry, map + body, pt->hold);
+    pt->ncarry = pt->hold;
+    munmap(map, size);
+  }
+  return ((size_t) offset == body)? 0 : -1;
+}
+
+/**
+ * Anything else: plain reads and writes through a buffer, keeping
+ * the last pt->hold bytes back each time.
+ **/
+int passthru_buffered(passthru_t *pt, int in, int out){
+  uint8_t *buf = malloc(pt->hold + PASSTHRU_BUFSIZE);
+  size_t have;
+  ssize_t n;
+  int retval = 0;
+
+  memcpy(buf, pt->carry, pt->ncarry);
+  have = pt->ncarry;
+  while ((n = read(in, buf + have, PASSTHRU_BUFSIZE)) != 0){
+    if (n < 0){
+      if (errno == EINTR)
+        continue;
+      retval = -1;
+      break;
+    }
+    pt->reg = crc_engine_update(pt->engine, pt->reg, buf + have, n);
+    have += n;
+    if (have > pt->hold){
+      if (passthru_write_all(out, buf, have - pt->hold)){
+        retval = -1;
+        break;
+      }
+      memmove(buf, buf + have - pt->hold, pt->hold);
+      have = pt->hold;
+    }
+  }
+  memcpy(pt->carry, buf, have);
+  pt->ncarry = have;
+  free(buf);
+  return retval;
+}
+
+/**
+ * The pipe-to-pipe case. Whatever is safe to forward (everything
+ * but the last pt->hold bytes seen so far) is tee()d to the output,
+ * and then read for the CRC. The rest is read into pt->carry, so
+ * that we can block waiting for more, and forwarded once more data
+ * shows that it isn't the trailer after all.
+ **/
+int passthru_pipes(passthru_t *pt, int in, int out){
+  uint8_t *buf = malloc(PASSTHRU_BUFSIZE);
+  struct pollfd pfd = {in, POLLIN, 0};
+  int avail, retval = -1;
+  size_t safe, flush, rest;
+  ssize_t t;
+
+  for (;;){
+    if (poll(&pfd, 1, -1) < 0){
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (ioctl(in, FIONREAD, &avail) < 0)
+      break;
+    if (avail == 0){
+      if (pfd.revents & (POLLHUP | POLLERR)){
+        retval = 0;
+        break;
+      }
+      continue;
+    }
+
+    safe = pt->ncarry + avail;
+    safe = (safe > pt->hold)? safe - pt->hold : 0;
+
+    flush = (pt->ncarry < safe)? pt->ncarry : safe;
+    if (flush){
+      if (passthru_write_all(out, pt->carry, flush))
+        break;
+      memmove(pt->carry, pt->carry + flush, pt->ncarry - flush);
+      pt->ncarry -= flush;
+      safe -= flush;
+    }
+
+    if (safe > PASSTHRU_BUFSIZE)
+      safe = PASSTHRU_BUFSIZE;
+    t = 0;
+    if (safe){
+      t = tee(in, out, safe, 0);
+      if (t < 0){
+        if (errno == EINTR)
+          continue;
+        // tee() isn't available everywhere; carry on without it.
+        if (errno == EINVAL){
+          free(buf);
+          return passthru_buffered(pt, in, out);
+        }
+        break;
+      }
+      if (passthru_consume(pt, in, buf, t))
+        break;
+    }
+    // Take what's left into the carry, if it's all that's left, so
+    // that the next poll() waits for more instead of spinning.
+    rest = avail - t;
+    if (rest && pt->ncarry + rest <= pt->hold){
+      if (passthru_consume(pt, in, pt->carry + pt->ncarry, rest))
+        break;
+      pt->ncarry += rest;
+    }
+  }
+  free(buf);
+  return retval;
+}
+
+/**
+ * Copy in to out, computing the CRC of everything read.
+ *
+ * With PASSTHRU_APPEND, the remainder is appended to the output.
+ * With PASSTHRU_STRIP, the input must end with such a trailer, which
+ * is left off the output; the residue is then that of the whole
+ * input, trailer included, and so 0 if nothing was damaged on the
+ * way. With PASSTHRU_PLAIN, the stream is forwarded as is. Note that
+ * when stripping, the data has been forwarded by the time we know
+ * whether it was damaged, so the verdict comes only through the
+ * residue.
+ *
+ * @return int : 0 on success, -1 on a read or write error, or if a
+ *         stream to be stripped was too short to hold a trailer
+ * @param const crc_engine_t *e : the engine to use
+ * @param int in : the fd to read from
+ * @param int out : the fd to write to
+ * @param int mode : PASSTHRU_PLAIN, PASSTHRU_APPEND or PASSTHRU_STRIP
+ * @param uint32_t *residue : set to the residue
+ **/
+int passthru(const crc_engine_t *e, int in, int out, int mode,
+             uint32_t *residue){
+  passthru_t pt;
+  struct stat in_st, out_st;
+  size_t trailer = (e->width + 7) / 8;
+  int retval, i;
+
+  memset(&pt, 0, sizeof(passthru_t));
+  pt.engine = e;
+  pt.hold = (mode == PASSTHRU_STRIP)? trailer : 0;
+
+  if (fstat(in, &in_st) || fstat(out, &out_st))
+    return -1;
+  if (S_ISREG(in_st.st_mode) && lseek(in, 0, SEEK_CUR) == 0)
+    retval = passthru_file(&pt, in, out, in_st.st_size);
+  else if (S_ISFIFO(in_st.st_mode) && S_ISFIFO(out_st.st_mode))
+    retval = passthru_pipes(&pt, in, out);
+  else
+    retval = passthru_buffered(&pt, in, out);
+
+  if (retval == 0 && pt.ncarry != pt.hold)
+    retval = -1;
+
+  if (retval == 0 && mode == PASSTHRU_APPEND){
+    uint8_t bytes[4];
+    for (i = 0; i < (int) trailer; i++)
+      bytes[i] = (pt.reg >> (8*i)) & 0xff;
+    retval = passthru_write_all(out, bytes, trailer);
+  }
+
+  *residue = crc_engine_residue(e, pt.reg);
+  return retval;
+}
@@ -0,0 +1,300 @@
+#include <pthread.h>
+
+/**
+ * Rolling CRC: the residue of every window-byte window of a stream,
+ * at constant cost per byte, for finding frame boundaries and
+ * content-defined chunk boundaries.
+ *
+ * Since the register starts at zero, a CRC is linear in the message,
+ * and leading zero bytes don't affect it. So when the window slides
+ * one byte along, we feed the incoming byte as usual, and cancel the
+ * outgoing byte by XORing in the register that byte alone would have
+ * left after passing through window more bytes. There are only 256
+ * such registers, which we tabulate up front.
+ *
+ * Include after crcengine.h. Link with -pthread.
+ **/
+
+#ifndef ROLL_CHUNK
+#define ROLL_CHUNK 0x100000
+#endif
+
+// The scan keeps a whole window in memory, so keep it sane.
+#define ROLL_MAX_WINDOW 0x40000000
+// Each thread has its own chunk of the buffer.
+#define ROLL_MAX_JOBS 64
+
+typedef struct crc_roller {
+  const crc_engine_t *engine;
+  size_t window;
+  uint32_t out[256]; // register left by each outgoing byte
+} crc_roller_t;
+
+/**
+ * Apply a linear map on registers, given as the images of its 32
+ * single bit registers, to a register.
+ **/
+uint32_t crc_roll_apply(const uint32_t *map, uint32_t reg){
+  uint32_t r = 0;
+  int j;
+  for (j = 0; reg; j++, reg >>= 1)
+    if (reg & 1)
+      r ^= map[j];
+  return r;
+}
+
+/**
+ * Prepare a roller for windows of the given size. Only the 8 single
+ * bit bytes are pushed through the window; the rest of the table
+ * follows by linearity. Pushing a register through a zero byte is
+ * itself linear, so rather than step through the window a byte at a
+ * time, we square that map up to the window size, which costs time
+ * in proportion to the log of the window.
+ *
+ * @param crc_roller_t *r : the roller to initialize
+ * @param const crc_engine_t *e : an initialized engine
+ * @param size_t window : the window size, in bytes, from 1 to
+ *        ROLL_MAX_WINDOW
+ **/
+void crc_roller_init(crc_roller_t *r, const crc_engine_t *e, size_t window){
+  uint32_t basis[8], zeros[32], square[32];
+  int k;
+  size_t i;
+  r->engine = e;
+  r->window = window;
+  for (k = 0; k < 8; k++){
+    uint8_t b = 1 << k;
+    basis[k] = crc_engine_update(e, 0, &b, 1);
+  }
+  // zeros[] starts as one zero byte, and doubles on every pass.
+  for (k = 0; k < 32; k++)
+    zeros[k] = ((1u << k) >> 8) ^ e->table[(1u << k) & 0xff];
+  for (i = window; i; i >>= 1){
+    if (i & 1)
+      for (k = 0; k < 8; k++)
+        basis[k] = crc_roll_apply(zeros, basis[k]);
+    for (k = 0; k < 32; k++)
+      square[k] = crc_roll_apply(zeros, zeros[k]);
+    memcpy(zeros, square, sizeof(zeros));
+  }
+  for (i = 0; i < 256; i++){
+    r->out[i] = 0;
+    for (k = 0; k < 8; k++)
+      if (i & (1 << k))
+        r->out[i] ^= basis[k];
+  }
+}
+
+/**
+ * Slide the window one byte along.
+ *
+ * @return uint32_t : the (reflected) register for the new window
+ * @param uint32_t reg : the register for the current window
+ * @param uint8_t outgoing : the first byte of the current window
+ * @param uint8_t incoming : the byte just past the current window
+ **/
+static inline uint32_t crc_roll(const crc_roller_t *r, uint32_t reg,
+                                uint8_t outgoing, uint8_t incoming){
+  return (reg >> 8) ^ r->engine->table[(reg ^ incoming) & 0xff]
+    ^ r->out[outgoing];
+}
+
+// A matching window, by its offset in the scan buffer.
+typedef struct crc_roll_match {
+  size_t pos;
+  uint32_t reg;
+} crc_roll_match_t;
+
+// A run of window positions, [from, to), rolled independently of the
+// others. If fresh, the register is seeded from scratch at from;
+// otherwise reg already holds the window at from, which has been
+// checked. Either way, reg is left holding the window at to - 1.
+typedef struct crc_roll_segment {
+  const crc_roller_t *roller;
+  const uint8_t *buf;
+  size_t from, to;
+  int fresh;
+  uint32_t reg, mask, target;
+  crc_roll_match_t *matches;
+  size_t n, size;
+  int failed;
+} crc_roll_segment_t;
+
+// Up to CRC_LANES segments, for one thread to roll in lockstep.
+typedef struct crc_roll_group {
+  crc_roll_segment_t *seg;
+  int n;
+} crc_roll_group_t;
+
+void crc_roll_found(crc_roll_segment_t *s, size_t pos, uint32_t reg){
+  if (s->n == s->size){
+    size_t size = s->size? 2 * s->size : 64;
+    crc_roll_match_t *m = realloc(s->matches,
+                                  size * sizeof(crc_roll_match_t));
+    if (m == NULL){
+      s->failed = 1;
+      return;
+    }
+    s->matches = m;
+    s->size = size;
+  }
+  s->matches[s->n].pos = pos;
+  s->matches[s->n++].reg = reg;
+}
+
+/**
+ * Roll a group of segments. As with crc_lanes_update(), the segments
+ * are independent, so stepping them in lockstep lets their lookups
+ * overlap; the scan of a single window can't, since every step waits
+ * on the one before it.
+ **/
+void * crc_roll_group(void *arg){
+  crc_roll_group_t *g = arg;
+  crc_roll_segment_t *s = g->seg;
+  const crc_roller_t *r = s->roller;
+  const uint8_t *buf = s->buf;
+  size_t window = r->window, common = SIZE_MAX, i, j;
+  const uint32_t *t = r->engine->table, *out = r->out;
+  const uint8_t *p[CRC_LANES];
+  uint32_t mask = s->mask, target = s->target, reg[CRC_LANES];
+  int l;
+
+  for (l = 0; l < g->n; l++){
+    p[l] = buf + s[l].from;
+    reg[l] = s[l].reg;
+    if (s[l].fresh){
+      reg[l] = crc_engine_update(r->engine, 0, buf + s[l].from, window);
+      if ((reg[l] & mask) == target)
+        crc_roll_found(&s[l], s[l].from, reg[l]);
+    }
+    if (s[l].to - s[l].from - 1 < common)
+      common = s[l].to - s[l].from - 1;
+  }
+  for (i = 0; i < common; i++)
+    for (l = 0; l < g->n; l++){
+      reg[l] = (reg[l] >> 8) ^ t[(reg[l] ^ p[l][i + window]) & 0xff]
+        ^ out[p[l][i]];
+      if ((reg[l] & mask) == target)
+        crc_roll_found(&s[l], s[l].from + i + 1, reg[l]);
+    }
+  // The segments differ in length by a byte or so; finish them off.
+  for (l = 0; l < g->n; l++){
+    for (j = s[l].from + common + 1; j < s[l].to; j++){
+      reg[l] = crc_roll(r, reg[l], buf[j - 1], buf[j - 1 + window]);
+      if ((reg[l] & mask) == target)
+        crc_roll_found(&s[l], j, reg[l]);
+    }
+    s[l].reg = reg[l];
+  }
+  return NULL;
+}
+
+/**
+ * Scan a stream, and report every window whose residue, masked with
+ * mask, equals target. The stream is read in chunks of ROLL_CHUNK
+ * bytes per thread, keeping only the last window of each around, so
+ * memory use doesn't depend on the size of the input.
+ *
+ * Since a window's register depends on nothing outside it, a chunk
+ * can be cut into segments, each seeded afresh with the CRC of its
+ * first window, and rolled on its own: CRC_LANES segments to a
+ * thread, in lockstep. Seeding costs a window's worth of lookups, so
+ * with large windows, fewer segments are used. Matches are collected
+ * per segment, and reported in order once the chunk is done.
+ *
+ * @return long int : the number of matching windows, or -1 if memory
+ *         ran out
+ * @param FILE *channel : the stream to scan
+ * @param const crc_roller_t *r : an initialized roller
+ * @param uint32_t mask : the residue bits to compare
+ * @param uint32_t target : the value those bits should have
+ * @param int jobs : the number of threads to use
+ * @param void (*report)(unsigned long int, uint32_t) : called with
+ *        the offset of the first byte of each matching window, and
+ *        its residue
+ **/
+long int crc_roll_scan(FILE *channel, const crc_roller_t *r,
+                       uint32_t mask, uint32_t target, int jobs,
+                       void (*report)(unsigned long int, uint32_t)){
+  const crc_engine_t *e = r->engine;
+  size_t window = r->window, size, have = 0, n, starts, i;
+  unsigned long int base = 0;
+  long int matches = 0;
+  uint32_t reg = 0;
+  int fresh = 1, failed = 0, nseg, ngroup, k;
+
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > ROLL_MAX_JOBS)
+    jobs = ROLL_MAX_JOBS;
+  size = window + (size_t) jobs * ROLL_CHUNK;
+  uint8_t *buf = malloc(size);
+  crc_roll_segment_t *seg = calloc(jobs * CRC_LANES,
+                                   sizeof(crc_roll_segment_t));
+  crc_roll_group_t *group = calloc(jobs, sizeof(crc_roll_group_t));
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+  if (buf == NULL || seg == NULL || group == NULL || threads == NULL)
+    failed = 1;
+
+  // Compare in reflected form, so the hot loop needn't convert.
+  mask = reflect_bits(mask, e->width);
+  target = reflect_bits(target, e->width) & mask;
+
+  while (!failed && (n = fread(buf + have, 1, size - have, channel)) > 0){
+    have += n;
+    if (have < window)
+      continue;
+
+    // Window positions 0 to have - window, split evenly.
+    starts = have - window + 1;
+    nseg = starts / (4 * window);
+    if (nseg > jobs * CRC_LANES)
+      nseg = jobs * CRC_LANES;
+    if (nseg < 1)
+      nseg = 1;
+    for (k = 0; k < nseg; k++){
+      seg[k].roller = r;
+      seg[k].buf = buf;
+      seg[k].from = starts * k / nseg;
+      seg[k].to = starts * (k + 1) / nseg;
+      seg[k].fresh = (k > 0 || fresh);
+      seg[k].reg = reg;
+      seg[k].mask = mask;
+      seg[k].target = target;
+      seg[k].n = 0;
+    }
+    ngroup = (nseg + CRC_LANES - 1) / CRC_LANES;
+    for (k = 0; k < ngroup; k++){
+      group[k].seg = &seg[k * CRC_LANES];
+      group[k].n = (nseg - k * CRC_LANES < CRC_LANES)?
+        nseg - k * CRC_LANES : CRC_LANES;
+    }
+    for (k = 1; k < ngroup; k++)
+      pthread_create(&threads[k], NULL, crc_roll_group, &group[k]);
+    crc_roll_group(&group[0]);
+    for (k = 1; k < ngroup; k++)
+      pthread_join(threads[k], NULL);
+
+    for (k = 0; k < nseg; k++){
+      failed |= seg[k].failed;
+      for (i = 0; i < seg[k].n; i++)
+        report(base + seg[k].matches[i].pos,
+               crc_engine_residue(e, seg[k].matches[i].reg));
+      matches += seg[k].n;
+    }
+    // Keep the last window at the front of the buffer.
+    reg = seg[nseg - 1].reg;
+    fresh = 0;
+    memmove(buf, buf + have - window, window);
+    base += have - window;
+    have = window;
+  }
+  if (seg)
+    for (k = 0; k < jobs * CRC_LANES; k++)
+      free(seg[k].matches);
+  free(seg);
+  free(group);
+  free(threads);
+  free(buf);
+  return failed? -1 : matches;
+}